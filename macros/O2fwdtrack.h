@@ -18,6 +18,7 @@
 #include <vector>
 #include <string>
 #include <unordered_map>
+#include <algorithm>
 
 #include <TH2.h>          
 #include <TEfficiency.h>  
@@ -29,6 +30,7 @@
 struct VarConfig {
     std::string name;
     bool isVariable;
+    int id = -1; // index into kVarRegistry, resolved once at booking
     
     // Parameters for both binning types
     int nbins;
@@ -57,11 +59,38 @@ struct EffPurityHists2D {
     
 };
 
+// Only what SelectBestMatches ranks on and FillEfficiencyNumerators reads, 16 bytes per candidate
 struct MatchCandidate {
-    Long64_t entry;
-    double chi2;
+    Float_t chi2;       // fChi2MatchMCHMFT
+    Float_t matchScore; // fMatchScoreMCHMFT
+    Int_t mchIndex;
     UChar_t mcMask;
-    double eta;
+};
+
+// How the candidate an MCH track is matched to is chosen
+enum MatchPolicy {
+    kLowestChi2,     // lowest fChi2MatchMCHMFT
+    kBestMatchScore  // highest fMatchScoreMCHMFT
+};
+
+// Match candidates of one DF in CSR layout. Candidates are appended to one flat buffer during the loop,
+// then counting-sorted by MCH index so those of MCH track m are candidates[offsets[m] .. offsets[m+1]).
+// best holds nBest ranked slots per MCH track (best first, -1 = empty), so a top-N study needs no extra container
+struct MatchCandidateStore {
+    std::vector<MatchCandidate> candidates;
+    std::vector<MatchCandidate> scratch; // reused by the counting sort
+    std::vector<UInt_t> offsets;
+    std::vector<Int_t> best;
+    int nBest = 1;
+
+    Long64_t nMCH() const { return offsets.empty() ? 0 : (Long64_t)offsets.size() - 1; }
+    const MatchCandidate* bestMatch(Long64_t mch, int rank = 0) const {
+        if (mch < 0 || mch >= nMCH() || rank >= nBest) return nullptr;
+        Int_t slot = best[mch * nBest + rank];
+        return slot < 0 ? nullptr : &candidates[slot];
+    }
+    // keeps the capacity, so the buffers are reused DF after DF
+    void clear() { candidates.clear(); offsets.clear(); best.clear(); }
 };
 
 struct EffPurityHists {
@@ -71,22 +100,194 @@ struct EffPurityHists {
     TH1D* hPurityTotal;
 };
 
+// MFT track columns of one DF, read in one sequential sweep so global muons can look up their
+// MFT track by plain array index instead of a random-access GetEntry on the MFT tree
+struct MFTTrackTable {
+    std::vector<ULong64_t> clusterSizesAndFlags; // raw fMFTClusterSizesAndTrackFlags
+    std::vector<UChar_t> nClusters;              // layers with a non-zero cluster size
+
+    size_t size() const { return nClusters.size(); }
+    // cluster size on MFT layer 0-9, 4 bits per layer
+    int clusterSize(size_t track, int layer) const { return (clusterSizesAndFlags[track] >> (4 * layer)) & 0xF; }
+    void clear() { clusterSizesAndFlags.clear(); nClusters.clear(); }
+};
+
+// Columns the efficiency/purity analysis reads, for type-0 and type-3 tracks in acceptance.
+// Written once as a skim cache so re-binning runs skip the ROOT decompression entirely
+struct SkimColumns {
+    std::vector<ULong64_t> dfOffsets{0}; // rows of DF d are [dfOffsets[d], dfOffsets[d+1])
+    std::vector<Double_t> pt, eta;       // as computed, so replay cuts and fills exactly the same values
+    std::vector<Float_t> phi, chi2, chi2MatchMCHMFT, matchScoreMCHMFT;
+    std::vector<Int_t> entry, mchIndex;  // DF-local fwd track indices
+    std::vector<UChar_t> trackType, nClusters, mcMask;
+};
+
+// Cache file layout: this header, then dfOffsets and every column of SkimColumns in declaration order
+struct SkimCacheHeader {
+    char magic[8];
+    ULong64_t version;
+    ULong64_t sourceHash; // input file names, sizes and modification times
+    ULong64_t cutHash;    // acceptance and skim selection
+    ULong64_t nRows;
+    ULong64_t nDataFrames;
+};
+
+// Read-only view of a memory-mapped skim cache
+struct SkimView {
+    void* base = nullptr;
+    size_t length = 0;
+    ULong64_t nRows = 0;
+    ULong64_t nDataFrames = 0;
+    const ULong64_t* dfOffsets = nullptr;
+    const Double_t *pt = nullptr, *eta = nullptr;
+    const Float_t *phi = nullptr, *chi2 = nullptr, *chi2MatchMCHMFT = nullptr, *matchScoreMCHMFT = nullptr;
+    const Int_t *entry = nullptr, *mchIndex = nullptr;
+    const UChar_t *trackType = nullptr, *nClusters = nullptr, *mcMask = nullptr;
+};
+
+// Raw counts behind the chi2 threshold scan. Each histogram is binned finely in chi2, so cumulative
+// sums along that axis give efficiency and purity at any threshold from a single analysis pass
+struct Chi2ScanHists {
+    TH1D* hEffNum = nullptr;   // best-match chi2 of type-3 tracks whose best match is true
+    TH1D* hPurTotal = nullptr; // MCH-MFT match chi2 of global muons
+    TH1D* hPurTrue = nullptr;  // same, true global muons only
+
+    // the same scan repeated in every bin of a few variables (x: chi2, y: variable)
+    std::vector<size_t> binnedVars; // indices into vars
+    std::vector<TH2D*> hEffNumBinned;
+    std::vector<TH2D*> hPurTotalBinned;
+    std::vector<TH2D*> hPurTrueBinned;
+};
+
+// Everything the efficiency/purity analysis books before the event loop and accumulates during it
+struct EffPurityAnalysis {
+    std::vector<VarConfig> vars;
+    std::vector<std::pair<std::string,std::string>> varPairs;
+    std::vector<std::pair<size_t,size_t>> pairIndices; // varPairs resolved to indices into vars
+    std::vector<EffPurityHists> histSets;
+    std::vector<EffPurityHists2D> hists2DSets;
+    TH1D* hChi2Optimization = nullptr;
+    Chi2ScanHists scan;
+
+    MatchCandidateStore matches;
+
+    // type-3 tracks in acceptance: their numerators can only be filled once all candidates are known
+    std::vector<Long64_t> pendingEntries;
+    std::vector<double> pendingValues; // vars.size() values per pending entry
+    std::vector<double> row;           // values of the current entry, in vars order
+
+    Long64_t nTotalType3 = 0;
+    Long64_t nMatchedType3 = 0;
+    Long64_t nTotalType0 = 0;
+    Long64_t nTrueType0 = 0;
+};
+
+// Per-thread copy of every histogram the event loop fills, merged into the booked ones at the end
+struct AnalysisSlot {
+    std::vector<std::vector<TH1D*>> hist;
+    EffPurityAnalysis ana;
+    Long64_t nbytes = 0;
+    Long64_t nDataFrames = 0;
+};
+
+// Where a shard stands, stored next to its histograms in every checkpoint
+struct ShardProgress {
+    ULong64_t sliceHash = 0;  // the slice's DF list
+    ULong64_t configHash = 0; // match settings and binning the histograms were filled with
+    Long64_t nSlice = 0;      // DFs in the slice
+    Long64_t nDone = 0;       // DFs of the slice gone through, where a rerun resumes
+    std::vector<std::string> skipped; // of those, the DFs without readable trees ("file\tDF"), as LoopParallel skips them
+};
+
+// FNV-1a, enough to notice a changed input, cut or plot source
+inline ULong64_t HashBytes(const void* data, size_t n, ULong64_t h = 1469598103934665603ULL) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < n; ++i) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Plots the renderer draws from output.root
+enum PlotKind {
+    kPlotDistribution,    // one branch, a pad per track type
+    kPlotEfficiency,
+    kPlotPurity,
+    kPlotCombined,        // efficiency and purity overlaid
+    kPlotSummary,         // efficiency vs pt, phi, nClusters and chi2 on one canvas
+    kPlotChi2Optimization,
+    kPlotEff2D,
+    kPlotPur2D
+};
+
+// One PNG and the output.root keys it is drawn from. hash covers the source objects' contents,
+// so a plot is only drawn again when what it shows has changed
+struct PlotJob {
+    PlotKind kind;
+    std::string name; // branch, variable or "x_vs_y" pair
+    std::string png;
+    std::vector<std::string> sources;
+    ULong64_t hash = 0;
+};
+
+// Cost of one analysis stage in the benchmark, accumulated over all DFs
+struct BenchStage {
+    std::string name;
+    double realTime = 0;        // s
+    double cpuTime = 0;         // s
+    Long64_t entries = 0;       // items the stage worked through
+    Long64_t bytesRead = 0;     // from the input file, compressed
+    Long64_t bytesUnzipped = 0; // returned by GetEntry
+    long peakRSS = 0;           // kB, highest VmHWM over the stage's runs, reset before each run
+};
+
 
 // Header file for the classes stored in the TTree if any.
 
+class O2fwdtrack;
+
+// Analysis variable: name used in VarConfig/varPairs, axis label, the branch it is computed from and
+// how to read it from the current entry once ComputeDerived() has run, and whether get() only reads
+// members ReplaySkimRow restores, i.e. whether LoopSkim can serve it from the cache.
+// Adding a variable means adding one kVarRegistry entry
+struct VarDef {
+    const char* name;
+    const char* axisTitle;
+    const char* branch;
+    double (*get)(const O2fwdtrack&);
+    bool inSkim;
+};
+
 class O2fwdtrack {
+public:
+  using BranchMember = Float_t O2fwdtrack::*;
+
 private:
   double fChi2Threshold{100.0}; // Default threshold for Chi2
+  MatchPolicy fMatchPolicy{kLowestChi2};
+  int fMatchTopN{1}; // ranked candidates kept per MCH track
+  std::vector<double> fChi2ScanGrid; // thresholds for the scan curves, empty = 1, 2, ... up to fChi2Threshold
+  std::vector<std::string> fChi2ScanBinnedVars{"pt", "eta"}; // variables the scan is also binned in
+  bool fRenderPlots{true}; // render the PNGs once the analysis output is closed
+  UInt_t fRenderWorkers{0}; // renderer processes, 0 = one per core
   
 public :
    TTree          *fChain{nullptr};   //!pointer to the analyzed TTree or TChain
    Int_t           fCurrent{-1}; //!current Tree number in a TChain
+   bool            fOwnsFile{true}; //!delete the input file with this object
    TH1D* fHDen  = nullptr;
    TH1D* fHNum  = nullptr;
    TTree* fMCLabelTree = nullptr;
 
    TTree* fMFTTree = nullptr;
    ULong64_t fMFTClusterSizesAndFlags;  // MFT cluster data
+   MFTTrackTable fMFTTable;             // MFT columns of the current DF, filled by LoadMFTTable()
+
+   // Branches shown in the per-track-type distributions and the track types they are split into
+   std::vector<std::string> fDistBranches{"fX", "fY", "fZ", "fPhi", "fTgl", "fSigned1Pt", "fChi2",
+                                          "fChi2MatchMCHMID", "fChi2MatchMCHMFT", "fMatchScoreMCHMFT"};
+   std::vector<int> fTrackTypes{0, 2, 3, 4};
 
 
 // Fixed size dimensions of array or collections stored in the TTree if any.
@@ -116,6 +317,15 @@ public :
    Float_t         fTrackTime;
    Float_t         fTrackTimeRes;
 
+   // Muon spectrometer acceptance
+   static constexpr double kEtaMin = -3.6;
+   static constexpr double kEtaMax = -2.5;
+
+   // Derived quantities of the current entry, computed once per entry
+   double          fPt;               // 1/|fSigned1Pt|, by ComputeDerived()
+   double          fEta;              // asinh(fTgl), by ProcessEntries for the acceptance cut
+   UInt_t          fNClustersCombined; // fNClusters, plus the MFT clusters of global muons, by ComputeDerived()
+
    // List of branches
    TBranch        *b_fIndexCollisions;   //!
    TBranch        *b_fTrackType;   //!
@@ -141,12 +351,22 @@ public :
    TBranch        *b_fTrackTimeRes;   //!
 
    O2fwdtrack(TTree *tree=0);
+   O2fwdtrack(TDirectory *dfDir);
    virtual ~O2fwdtrack();
    virtual Int_t    Cut(Long64_t entry);
    virtual Int_t    GetEntry(Long64_t entry);
    virtual Long64_t LoadTree(Long64_t entry);
    virtual void     Init(TTree *tree);
+   virtual void     InitDataFrame(TDirectory *dir);
+   void             ReleaseDataFrame(TDirectory *dir);
    virtual void     Loop(TFile* outputfile = nullptr);
+   virtual void     LoopParallel(const std::vector<std::string>& inputFiles, UInt_t nThreads = 0,
+                                 TFile* outputfile = nullptr);
+   virtual void     LoopSkim(const std::vector<std::string>& inputFiles, const std::string& cacheFile,
+                             TFile* outputfile = nullptr);
+   virtual void     LoopShard(const std::vector<std::string>& inputFiles, const std::string& shardFile,
+                              Long64_t firstDF = 0, Long64_t nDF = -1, Long64_t checkpointEvery = 10);
+   virtual void     MergeShards(const std::vector<std::string>& shardFiles, TFile* outputfile = nullptr);
    virtual bool     Notify();
    virtual void     Show(Long64_t entry = -1);
    
@@ -183,34 +403,60 @@ void Graphing2D(TFile* outfile, const std::vector<std::pair<std::string,std::str
 //  Helper-function definitions for efficiency/purity analysis;
 // ==========================================================================================================================================
 
-double GetVarValue(const std::string& varname);
+static int FindVar(const std::string& varname);
+
+void ResolveVariables(EffPurityAnalysis& ana);
+
+void ComputeDerived();
 
 bool IsInAcceptance(double eta);
 
 int getMFTClusterCount(ULong64_t clusterSizesAndFlags);
 
-void CalculateEfficiencyPurity(TFile* outfile);
+static void CountMFTClusters(const ULong64_t* clusterSizesAndFlags, UChar_t* counts, size_t n);
+
+Long64_t LoadMFTTable();
+
+void DefineEfficiencyVariables(std::vector<VarConfig>& vars, std::vector<std::pair<std::string,std::string>>& varPairs);
+
+void BookEfficiencyPurity(TFile* outfile, EffPurityAnalysis& ana);
+
+void CalculateEfficiencyPurity(TFile* outfile, EffPurityAnalysis& ana);
+
+void ResolveMatches(EffPurityAnalysis& ana);
+
+void FillNumeratorsAndClear(EffPurityAnalysis& ana);
+
+void FinalizeEfficiencyPurity(TFile* outfile, EffPurityAnalysis& ana);
+
+static std::vector<TH1*> RawHistograms(const EffPurityAnalysis& ana);
 
 void CreateEfficiencyPurityHistograms( TFile* outfile, const std::vector<VarConfig>& vars, std::vector<EffPurityHists>& histSets,  TH1D*& hChi2Optimization);
 
-void CollectMatchCandidates(std::unordered_map<Long64_t, std::vector<MatchCandidate>>& matchCandidates);
+void CollectMatchCandidate(MatchCandidateStore& matches);
+
+void BuildMatchIndex(MatchCandidateStore& matches);
 
-void SelectBestMatches(const std::unordered_map<Long64_t, std::vector<MatchCandidate>>& matchCandidates, 
-            std::unordered_map<Long64_t, const MatchCandidate*>& bestMatches);
+void SelectBestMatches(MatchCandidateStore& matches);
 
-void FillEfficiencyPurityCounts(
-    const std::unordered_map<Long64_t,const MatchCandidate*>& bestMatches,
-    const std::vector<VarConfig>& vars,
-    std::vector<EffPurityHists>& histSets,
-    const std::vector<std::pair<std::string,std::string>>& varPairs,
-    const std::vector<EffPurityHists2D>& hists2DSets,
-    Long64_t& nTotalType3,
-    Long64_t& nMatchedType3,
-    Long64_t& nTotalType0,
-    Long64_t& nTrueType0);
+void FillEfficiencyPurityCounts(Long64_t ientry, EffPurityAnalysis& ana);
+
+void FillEfficiencyNumerators(EffPurityAnalysis& ana);
 
 void SetChi2Threshold(double thresh) { fChi2Threshold = thresh; };
 
+void SetMatchPolicy(MatchPolicy policy, int topN = 1) { fMatchPolicy = policy; fMatchTopN = std::max(1, topN); };
+
+void SetChi2ScanGrid(const std::vector<double>& grid) { fChi2ScanGrid = grid; };
+
+void SetChi2ScanBinnedVars(const std::vector<std::string>& names) { fChi2ScanBinnedVars = names; };
+
+void CreateChi2ScanHistograms(TFile* outfile, EffPurityAnalysis& ana);
+
+void FillChi2Scan(EffPurityAnalysis& ana, double chi2, const double* values, bool isType3, bool isTrue);
+
+void ComputeChi2Scan(TFile* outfile, EffPurityAnalysis& ana);
+
 void Create2DEffPurHists(TFile* outfile, const std::vector<std::pair<std::string,std::string>>& varPairs,
             const std::vector<VarConfig>& vars, std::vector<EffPurityHists2D>& hists2DSets);
 
@@ -221,26 +467,147 @@ void Create2DEffPurHists(TFile* outfile, const std::vector<std::pair<std::string
 
 TFile* outputManagement(TFile* outputfile, bool& closeFile);
 
+void SetPlotStyle();
+
+void EnableBranches(const std::vector<std::string>& branches);
+
+static std::vector<BranchMember> ResolveDistBranches(const std::vector<std::string>& branches);
+
+void ProcessEntries(Long64_t nentries, Long64_t& nbytes, Long64_t& nb,
+                                const std::vector<BranchMember>& distMembers, int ntype,
+                                const int trackTypes[], std::vector<std::vector<TH1D*>>& hist,
+                                EffPurityAnalysis& ana);
+
 
 void initializeHistograms(const std::vector<std::string>& branches,
                                       int nbranches, int ntype,const int trackTypes[],
                                       std::vector<std::vector<TH1D*>>& hist);
 
-void fillHistograms(Long64_t nentries, Long64_t& nbytes, Long64_t& nb,
-                                const std::vector<std::string>& branches,int nbranches, int ntype,
+void fillHistograms(const std::vector<BranchMember>& distMembers, int ntype,
                                 const int trackTypes[], std::vector<std::vector<TH1D*>>& hist);
 
 void normalizeHistograms(int nbranches, int ntype,
                                      std::vector<std::vector<TH1D*>>& hist);
 
-void canvasManipulation(const std::vector<std::string>& branches,int nbranches, int ntype,
-            const int trackTypes[],std::vector<std::vector<TH1D*>>& hist,TFile* outfile);
+void writeHistograms(int nbranches, int ntype, std::vector<std::vector<TH1D*>>& hist, TFile* outfile);
+
+void FinishOutput(TFile* outfile, bool closeFile);
+
+static bool ReplaceFile(const std::string& tmpFile, const std::string& file);
 
 
 //==========================================================================================================================================
+//  Helper-function definitions for parallel processing over DF directories;
+// ==========================================================================================================================================
+
+std::vector<std::pair<std::string,std::string>> FindDataFrames(const std::vector<std::string>& inputFiles);
+
+void CloneSlot(const std::vector<std::vector<TH1D*>>& hist, const EffPurityAnalysis& ana, AnalysisSlot& slot);
+
+bool ProcessDataFrame(TDirectory* dir, const std::vector<BranchMember>& distMembers, AnalysisSlot& slot);
+
+void MergeSlot(AnalysisSlot& slot, std::vector<std::vector<TH1D*>>& hist, EffPurityAnalysis& ana);
+
+
 //==========================================================================================================================================
+//  Helper-function definitions for the columnar skim cache;
+// ==========================================================================================================================================
+
+static ULong64_t SkimSourceHash(const std::vector<std::string>& inputFiles);
+
+static ULong64_t SkimCutHash();
+
+Long64_t SkimDataFrame(SkimColumns& cols);
+
+bool WriteSkimCache(const std::vector<std::string>& inputFiles, const std::string& cacheFile,
+            ULong64_t sourceHash, ULong64_t cutHash);
+
+static bool MapSkimCache(const std::string& cacheFile, ULong64_t sourceHash, ULong64_t cutHash, SkimView& view);
+
+static void UnmapSkimCache(SkimView& view);
+
+void ReplaySkimRow(const SkimView& view, ULong64_t row, EffPurityAnalysis& ana);
+
+
+//==========================================================================================================================================
+//  Helper-function definitions for sharded, checkpointed runs;
+// ==========================================================================================================================================
+
+ULong64_t ShardConfigHash();
+
+static bool WriteCheckpoint(const std::string& shardFile, const ShardProgress& progress,
+            const std::vector<std::pair<std::string,std::string>>& slice,
+            const std::vector<TH1*>& hists, const EffPurityAnalysis& ana);
+
+static bool ReadCheckpoint(const std::string& shardFile, ShardProgress& progress,
+            const std::vector<TH1*>& hists, EffPurityAnalysis& ana);
+
+static bool AddShard(TFile* shard, const std::vector<TH1*>& hists, EffPurityAnalysis& ana);
 
 
+//==========================================================================================================================================
+//  Helper-function definitions for the plot renderer;
+// ==========================================================================================================================================
+
+void SetRenderPlots(bool render, UInt_t nWorkers = 0) { fRenderPlots = render; fRenderWorkers = nWorkers; };
+
+int RenderPlots(const std::string& outputFile = "output/output.root", UInt_t nWorkers = 0, bool force = false,
+                const std::string& plotDir = "output");
+
+static std::vector<PlotJob> BuildPlotJobs(TFile* file, const std::string& plotDir);
+
+static ULong64_t HashPlotSources(TFile* file, const PlotJob& job);
+
+bool RenderPlot(TFile* file, const PlotJob& job);
+
+
+//==========================================================================================================================================
+//  Helper-function definitions for the benchmark harness;
+// ==========================================================================================================================================
+
+static Long64_t GenerateSyntheticAO2D(const std::string& fileName, int nDataFrames, int nMCHPerDF, UInt_t seed = 1);
+
+void Benchmark(const std::string& inputFile, bool render = true, const std::string& perfStatsPrefix = "");
+
+static void PrintBenchmark(const std::vector<BenchStage>& stages);
+
+
+//==========================================================================================================================================
+//==========================================================================================================================================
+
+
+};
+
+inline constexpr VarDef kVarRegistry[] = {
+    {"pt", "p_{T} (GeV/c)", "fSigned1Pt", [](const O2fwdtrack &t) -> double { return t.fPt; }, true},
+    {"eta", "#eta", "fTgl", [](const O2fwdtrack &t) -> double { return t.fEta; }, true},
+    {"phi", "#phi (rad)", "fPhi", [](const O2fwdtrack &t) -> double { return t.fPhi; }, true},
+    {"chi2", "#chi^{2}/ndf", "fChi2", [](const O2fwdtrack &t) -> double { return t.fChi2; }, true},
+    {"nClusters", "N_{clusters}", "fNClusters", [](const O2fwdtrack &t) -> double { return t.fNClustersCombined; }, true},
+};
+inline constexpr int kNVars = sizeof(kVarRegistry) / sizeof(kVarRegistry[0]);
+
+// Float branches that can be shown in the per-track-type distributions
+struct DistBranchDef {
+    const char* name;
+    O2fwdtrack::BranchMember member;
+};
+
+inline constexpr DistBranchDef kDistBranchRegistry[] = {
+    {"fX", &O2fwdtrack::fX},
+    {"fY", &O2fwdtrack::fY},
+    {"fZ", &O2fwdtrack::fZ},
+    {"fPhi", &O2fwdtrack::fPhi},
+    {"fTgl", &O2fwdtrack::fTgl},
+    {"fSigned1Pt", &O2fwdtrack::fSigned1Pt},
+    {"fPDca", &O2fwdtrack::fPDca},
+    {"fRAtAbsorberEnd", &O2fwdtrack::fRAtAbsorberEnd},
+    {"fChi2", &O2fwdtrack::fChi2},
+    {"fChi2MatchMCHMID", &O2fwdtrack::fChi2MatchMCHMID},
+    {"fChi2MatchMCHMFT", &O2fwdtrack::fChi2MatchMCHMFT},
+    {"fMatchScoreMCHMFT", &O2fwdtrack::fMatchScoreMCHMFT},
+    {"fTrackTime", &O2fwdtrack::fTrackTime},
+    {"fTrackTimeRes", &O2fwdtrack::fTrackTimeRes},
 };
 
 #endif
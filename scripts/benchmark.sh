@@ -0,0 +1,71 @@
+#!/bin/bash
+# Script to benchmark the analysis stages on a synthetic AO2D file, using pre-compiled shared libraries
+# Usage: ./scripts/benchmark.sh [-d nDFs] [-n nMCHTracksPerDF] [-s seed] [-j nWorkers] [-i input.root] [-p] [--no-plots]
+#   generates output/benchmark/synthetic_AO2D.root (default 8 DFs of 2000 MCH tracks) unless -i names
+#   an existing AO2D file, then reports wall time, entries/s, bytes read and decompressed and peak RSS
+#   for booking, event loop, best-match selection, numerator filling, finalize/write and rendering
+#   (-j renderer workers);
+#   -p saves TTreePerfStats I/O traces to output/benchmark/ioperf_<DF>.root
+
+USAGE="Usage: $0 [-d nDFs] [-n nMCHTracksPerDF] [-s seed] [-j nWorkers] [-i input.root] [-p] [--no-plots]"
+
+# long options to their getopts letters
+for arg in "$@"; do
+    shift
+    case $arg in
+        --no-plots) set -- "$@" -x ;;
+        *) set -- "$@" "$arg" ;;
+    esac
+done
+
+NDF=8
+NMCH=2000
+SEED=1
+NWORKERS=0
+INPUT=""
+PERFSTATS=""
+RENDER=true
+while getopts "d:n:s:j:i:px" opt; do
+    case $opt in
+        d) NDF=$OPTARG ;;
+        n) NMCH=$OPTARG ;;
+        s) SEED=$OPTARG ;;
+        j) NWORKERS=$OPTARG ;;
+        i) INPUT=$(realpath "$OPTARG") ;;
+        p) PERFSTATS="output/benchmark/ioperf" ;;
+        x) RENDER=false ;;
+        *) echo "$USAGE"; exit 1 ;;
+    esac
+done
+
+# Get the project root directory
+PROJECT_ROOT="$(cd "$(dirname "${BASH_SOURCE[0]}")/.." && pwd)"
+mkdir -p $PROJECT_ROOT/output/benchmark
+cd $PROJECT_ROOT
+
+if [ -z "$INPUT" ]; then
+    INPUT="output/benchmark/synthetic_AO2D.root"
+    GENERATE="std::cout << O2fwdtrack::GenerateSyntheticAO2D(\"$INPUT\", $NDF, $NMCH, $SEED) << \" synthetic fwd tracks written\" << std::endl;"
+fi
+
+echo "Running benchmark on $INPUT..."
+
+root -l -b << EOF
+// Load the pre-compiled shared libraries
+.L ./macros/O2fwdtrackHelpers_C.so
+.L ./macros/O2fwdtrackEfficiency_C.so
+.L ./macros/O2fwdtrackGraphing_C.so
+.L ./macros/O2fwdtrackParallel_C.so
+.L ./macros/O2fwdtrackSkim_C.so
+.L ./macros/O2fwdtrackRender_C.so
+.L ./macros/O2fwdtrackBenchmark_C.so
+.L ./macros/O2fwdtrackShard_C.so
+.L ./macros/O2fwdtrack_C.so
+
+$GENERATE
+O2fwdtrack fwd((TDirectory *)nullptr);
+fwd.SetRenderPlots(true, $NWORKERS);
+fwd.Benchmark("$INPUT", $RENDER, "$PERFSTATS");
+
+.q
+EOF
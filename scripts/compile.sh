@@ -8,6 +8,11 @@ root -l -b  << EOF
 .L ./macros/O2fwdtrackHelpers.C++
 .L ./macros/O2fwdtrackEfficiency.C++
 .L ./macros/O2fwdtrackGraphing.C++
+.L ./macros/O2fwdtrackParallel.C++
+.L ./macros/O2fwdtrackSkim.C++
+.L ./macros/O2fwdtrackRender.C++
+.L ./macros/O2fwdtrackBenchmark.C++
+.L ./macros/O2fwdtrackShard.C++
 .L ./macros/O2fwdtrack.C++
 
 .q
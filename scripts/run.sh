@@ -1,5 +1,92 @@
 #!/bin/bash
 # Script to run the analysis using pre-compiled shared libraries
+# Usage: ./scripts/run.sh [-j nThreads] [-c skim.cache] [--no-plots | --render-only] [input.root ...]
+#        ./scripts/run.sh -s shard.root [-d firstDF:nDFs] [-k checkpointEvery] [input.root ...]
+#        ./scripts/run.sh -m [--no-plots] shard.root ...
+#   without input files the default DF of data/AO2D_MC_promptJpsi_anch24_merged.root is analysed;
+#   with input files every DF_ directory they contain is processed in parallel (-j 0 = all cores);
+#   with -c only efficiency/purity is run, from a columnar skim cache that is (re)built when
+#   missing or out of date (default input: the data file above);
+#   plots are rendered from output/output.root after the analysis by -j worker processes, only those
+#   whose source objects changed: --no-plots skips them, --render-only re-renders without analysing;
+#   with -s the DFs of the input files (default: the data file above), or the -d range of them, are
+#   analysed into shard.root, checkpointed every -k DFs (default 10) and resumed when rerun;
+#   with -m the finished shards are added and efficiency/purity is computed into output/output.root
+
+USAGE="Usage: $0 [-j nThreads] [-c skim.cache] [--no-plots | --render-only] [input.root ...]
+       $0 -s shard.root [-d firstDF:nDFs] [-k checkpointEvery] [input.root ...]
+       $0 -m [--no-plots] shard.root ..."
+
+# long options to their getopts letters
+for arg in "$@"; do
+    shift
+    case $arg in
+        --no-plots) set -- "$@" -n ;;
+        --render-only) set -- "$@" -r ;;
+        *) set -- "$@" "$arg" ;;
+    esac
+done
+
+NTHREADS=0
+CACHE=""
+PLOTS=true
+RENDER_ONLY=false
+SHARD=""
+RANGE="0:-1"
+CHECKPOINT=10
+MERGE=false
+while getopts "j:c:nrs:d:k:m" opt; do
+    case $opt in
+        j) NTHREADS=$OPTARG ;;
+        c) CACHE=$(realpath "$OPTARG") ;;
+        n) PLOTS=false ;;
+        r) RENDER_ONLY=true ;;
+        s) SHARD=$(realpath "$OPTARG") ;;
+        d) RANGE=$OPTARG ;;
+        k) CHECKPOINT=$OPTARG ;;
+        m) MERGE=true ;;
+        *) echo "$USAGE"; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+if $RENDER_ONLY; then
+    SETUP="O2fwdtrack fwd((TDirectory *)nullptr);"
+    ANALYSIS="fwd.RenderPlots(\"output/output.root\", $NTHREADS);"
+elif $MERGE; then
+    FILES=""
+    for f in "$@"; do
+        FILES+="\"$(realpath "$f")\","
+    done
+    SETUP="O2fwdtrack fwd((TDirectory *)nullptr);"
+    ANALYSIS="fwd.MergeShards({${FILES%,}});"
+elif [ -n "$SHARD" ]; then
+    [ $# -gt 0 ] || set -- "$(dirname "${BASH_SOURCE[0]}")/../data/AO2D_MC_promptJpsi_anch24_merged.root"
+    FILES=""
+    for f in "$@"; do
+        FILES+="\"$(realpath "$f")\","
+    done
+    SETUP="O2fwdtrack fwd((TDirectory *)nullptr);"
+    ANALYSIS="fwd.LoopShard({${FILES%,}}, \"$SHARD\", ${RANGE%%:*}, ${RANGE#*:}, $CHECKPOINT);"
+elif [ -n "$CACHE" ]; then
+    [ $# -gt 0 ] || set -- "$(dirname "${BASH_SOURCE[0]}")/../data/AO2D_MC_promptJpsi_anch24_merged.root"
+    FILES=""
+    for f in "$@"; do
+        FILES+="\"$(realpath "$f")\","
+    done
+    SETUP="O2fwdtrack fwd((TDirectory *)nullptr);"
+    ANALYSIS="fwd.LoopSkim({${FILES%,}}, \"$CACHE\");"
+elif [ $# -gt 0 ]; then
+    FILES=""
+    for f in "$@"; do
+        FILES+="\"$(realpath "$f")\","
+    done
+    SETUP="O2fwdtrack fwd((TDirectory *)nullptr);"
+    ANALYSIS="fwd.LoopParallel({${FILES%,}}, $NTHREADS);"
+else
+    SETUP="O2fwdtrack fwd;"
+    ANALYSIS="fwd.Loop();"
+fi
 
 echo "Running analysis..."
 
@@ -14,16 +101,22 @@ mkdir -p $PROJECT_ROOT/output/png_graph_class
 cd $PROJECT_ROOT
 
 # Run the analysis using pre-compiled shared libraries
-root -l -b << 'EOF'
+root -l -b << EOF
 // Load the pre-compiled shared libraries
 .L ./macros/O2fwdtrackHelpers_C.so
 .L ./macros/O2fwdtrackEfficiency_C.so
 .L ./macros/O2fwdtrackGraphing_C.so
+.L ./macros/O2fwdtrackParallel_C.so
+.L ./macros/O2fwdtrackSkim_C.so
+.L ./macros/O2fwdtrackRender_C.so
+.L ./macros/O2fwdtrackBenchmark_C.so
+.L ./macros/O2fwdtrackShard_C.so
 .L ./macros/O2fwdtrack_C.so
 
 // Create instance and run analysis
-O2fwdtrack fwd;
-fwd.Loop();
+$SETUP
+fwd.SetRenderPlots($PLOTS, $NTHREADS);
+$ANALYSIS
 
 .q
 EOF